@@ -3,21 +3,24 @@
     'target_name': 'attention',
     'sources': [
       'src/exoquant/exoquant.c',
+      'src/profile.cc',
       'src/resizer.cc',
       'src/mask.cc',
+      'src/duplicates.cc',
       'src/palette.cc',
       'src/region.cc',
       'src/point.cc',
+      'src/environment.cc',
       'src/attention.cc'
     ],
     'variables': {
       'PKG_CONFIG_PATH': '<!(which brew >/dev/null 2>&1 && eval $(brew --env) && echo $PKG_CONFIG_LIBDIR || true):$PKG_CONFIG_PATH:/usr/local/lib/pkgconfig:/usr/lib/pkgconfig'
     },
     'libraries': [
-      '<!(PKG_CONFIG_PATH="<(PKG_CONFIG_PATH)" pkg-config --libs vips-cpp)'
+      '<!(PKG_CONFIG_PATH="<(PKG_CONFIG_PATH)" pkg-config --libs vips-cpp lcms2)'
     ],
     'include_dirs': [
-      '<!(PKG_CONFIG_PATH="<(PKG_CONFIG_PATH)" pkg-config --cflags vips-cpp glib-2.0)',
+      '<!(PKG_CONFIG_PATH="<(PKG_CONFIG_PATH)" pkg-config --cflags vips-cpp glib-2.0 lcms2)',
       '<!(node -e "require(\'nan\')")',
       '/usr/include/malloc'
     ],
@@ -7,7 +7,9 @@ var Attention = function(input) {
     return new Attention(input);
   }
   this.options = {
-    swatches: 10
+    swatches: 10,
+    progressive: false,
+    reuse: -1
   };
   if (typeof input === 'string') {
     this.options.file = input;
@@ -32,6 +34,26 @@ Attention.prototype.swatches = function(swatches) {
   return this;
 };
 
+/*
+  Report a quick estimate before the refined region or point
+*/
+Attention.prototype.progressive = function(progressive) {
+  this.options.progressive = (typeof progressive === 'boolean') ? progressive : true;
+  return this;
+};
+
+/*
+  Reuse results of near-duplicate images within a perceptual hash distance of 0-64 bits
+*/
+Attention.prototype.reuse = function(distance) {
+  if (typeof distance === 'number' && !Number.isNaN(distance) && distance % 1 === 0 && distance >= 0 && distance <= 64) {
+    this.options.reuse = distance;
+  } else {
+    throw new Error('Invalid perceptual hash distance (0 - 64): ' + distance);
+  }
+  return this;
+};
+
 /*
   Find the most salient region in an image
 */
@@ -1,19 +1,33 @@
+#include <mutex>
 #include <vips/vips8>
 
 #include "nan.h"
+#include "environment.h"
 #include "palette.h"
 #include "region.h"
 #include "point.h"
 
+/*
+  libvips, its thread pool and the caches of this module are process-wide,
+  so initialise libvips once however many contexts load the module
+*/
+static std::once_flag vipsInitFlag;
+
 NAN_MODULE_INIT(init) {
-  vips_init("attention");
+  std::call_once(vipsInitFlag, []() {
+    vips_init("attention");
+  });
+
+  // State of the environment loading the module, passed to each function
+  v8::Local<v8::External> environment = Nan::New<v8::External>(new Environment);
 
   Nan::Set(target, Nan::New("palette").ToLocalChecked(),
-    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(palette)).ToLocalChecked());
+    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(palette, environment)).ToLocalChecked());
   Nan::Set(target, Nan::New("region").ToLocalChecked(),
-    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(region)).ToLocalChecked());
+    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(region, environment)).ToLocalChecked());
   Nan::Set(target, Nan::New("point").ToLocalChecked(),
-    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(point)).ToLocalChecked());
+    Nan::GetFunction(Nan::New<v8::FunctionTemplate>(point, environment)).ToLocalChecked());
 }
 
-NODE_MODULE(attention, init)
+// Context-aware, allowing use from multiple worker_threads
+NAN_MODULE_WORKER_ENABLED(attention, init)
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cmath>
+#include <vips/vips8>
+
+#include "duplicates.h"
+
+/*
+  Add results from another entry, replacing any of the same type
+*/
+void NearDuplicate::Merge(const NearDuplicate &other) {
+  aspectRatio = other.aspectRatio;
+  if (other.hasRegion) {
+    hasRegion = true;
+    top = other.top;
+    left = other.left;
+    bottom = other.bottom;
+    right = other.right;
+  }
+  if (other.hasPoint) {
+    hasPoint = true;
+    x = other.x;
+    y = other.y;
+  }
+  for (std::map<int, std::vector<unsigned char> >::const_iterator it = other.palettes.begin(); it != other.palettes.end(); ++it) {
+    palettes[it->first] = it->second;
+  }
+};
+
+/*
+  Is this entry for an image with the given aspect ratio?
+*/
+bool NearDuplicate::HasAspectRatio(double ratio) const {
+  return fabs(aspectRatio / ratio - 1.0) < 0.01;
+};
+
+/*
+  Approximate memory used by this entry, in bytes
+*/
+size_t NearDuplicate::Bytes() const {
+  size_t total = sizeof(NearDuplicate);
+  for (std::map<int, std::vector<unsigned char> >::const_iterator it = palettes.begin(); it != palettes.end(); ++it) {
+    // Allow for the overhead of each map node
+    total += it->second.capacity() + 64;
+  }
+  return total;
+};
+
+/*
+  Does this entry have the same aspect ratio and hold the wanted results?
+*/
+bool NearDuplicateQuery::IsMetBy(const NearDuplicate &entry) const {
+  return entry.HasAspectRatio(aspectRatio) &&
+    (!region || entry.hasRegion) &&
+    (!point || entry.hasPoint) &&
+    (swatches == 0 || entry.palettes.count(swatches) > 0);
+};
+
+/*
+  Number of bits that differ between two hashes
+*/
+static int HammingDistance(uint64_t a, uint64_t b) {
+  return __builtin_popcountll(a ^ b);
+};
+
+/*
+  In-memory BK-tree, evicting its least recently used entries when it exceeds maxBytes
+*/
+BKTreeIndex::BKTreeIndex(const size_t maxBytes) {
+  this->root = NULL;
+  this->bytes = 0;
+  this->maxBytes = maxBytes;
+  this->clock = 0;
+};
+
+BKTreeIndex::~BKTreeIndex() {
+  Delete(root);
+};
+
+void BKTreeIndex::Delete(Node *node) {
+  if (node != NULL) {
+    for (std::map<int, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+      Delete(it->second);
+    }
+    delete node;
+  }
+};
+
+/*
+  Approximate memory used by a node, in bytes, allowing for its entry in the map of its parent
+*/
+static size_t NodeBytes(const NearDuplicate &entry) {
+  return entry.Bytes() + sizeof(uint64_t) * 2 + sizeof(std::map<int, void*>) + 64;
+};
+
+/*
+  Visit only those children whose distance from this node could be within maxDistance of hash
+*/
+void BKTreeIndex::Search(Node *node, uint64_t hash, int maxDistance, const NearDuplicateQuery &query,
+  Node **nearest, int *nearestDistance) {
+  const int distance = HammingDistance(node->hash, hash);
+  if (distance <= maxDistance && distance < *nearestDistance && query.IsMetBy(node->entry)) {
+    *nearest = node;
+    *nearestDistance = distance;
+  }
+  std::map<int, Node*>::iterator it = node->children.lower_bound(distance - maxDistance);
+  std::map<int, Node*>::iterator end = node->children.upper_bound(distance + maxDistance);
+  for (; it != end; ++it) {
+    Search(it->second, hash, maxDistance, query, nearest, nearestDistance);
+  }
+};
+
+bool BKTreeIndex::Find(uint64_t hash, int maxDistance, const NearDuplicateQuery &query, NearDuplicate *match) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (root == NULL) {
+    return false;
+  }
+  Node *nearest = NULL;
+  int nearestDistance = maxDistance + 1;
+  Search(root, hash, maxDistance, query, &nearest, &nearestDistance);
+  if (nearest == NULL) {
+    return false;
+  }
+  nearest->lastUsed = ++clock;
+  *match = nearest->entry;
+  return true;
+};
+
+/*
+  Add a node without children to the tree
+*/
+void BKTreeIndex::Insert(Node *node) {
+  Node **parent = &root;
+  while (*parent != NULL) {
+    parent = &(*parent)->children[HammingDistance((*parent)->hash, node->hash)];
+  }
+  *parent = node;
+};
+
+void BKTreeIndex::Collect(Node *node, std::vector<Node*> *nodes) {
+  if (node != NULL) {
+    for (std::map<int, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+      Collect(it->second, nodes);
+    }
+    node->children.clear();
+    nodes->push_back(node);
+  }
+};
+
+bool BKTreeIndex::MoreRecentlyUsed(const Node *a, const Node *b) {
+  return a->lastUsed > b->lastUsed;
+};
+
+/*
+  Keep the most recently used entries that fit within three quarters of maxBytes
+  and rebuild the tree from them, as a BK-tree cannot remove individual entries
+*/
+void BKTreeIndex::Evict() {
+  std::vector<Node*> nodes;
+  Collect(root, &nodes);
+  std::sort(nodes.begin(), nodes.end(), MoreRecentlyUsed);
+  root = NULL;
+  bytes = 0;
+  for (std::vector<Node*>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+    const size_t nodeBytes = NodeBytes((*it)->entry);
+    if (bytes + nodeBytes <= maxBytes / 4 * 3) {
+      Insert(*it);
+      bytes += nodeBytes;
+    } else {
+      delete *it;
+    }
+  }
+};
+
+void BKTreeIndex::Store(uint64_t hash, const NearDuplicate &entry) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Node **node = &root;
+  while (*node != NULL) {
+    const int distance = HammingDistance((*node)->hash, hash);
+    if (distance == 0 && (*node)->entry.HasAspectRatio(entry.aspectRatio)) {
+      break;
+    }
+    node = &(*node)->children[distance];
+  }
+  if (*node != NULL) {
+    bytes -= NodeBytes((*node)->entry);
+    (*node)->entry.Merge(entry);
+  } else {
+    *node = new Node;
+    (*node)->hash = hash;
+    (*node)->entry = entry;
+  }
+  (*node)->lastUsed = ++clock;
+  bytes += NodeBytes((*node)->entry);
+  if (bytes > maxBytes) {
+    Evict();
+  }
+};
+
+/*
+  Process-wide index, chosen by the first call to either SetIndex or Index.
+  Deliberately leaked, as libuv threads may still be using it at exit.
+*/
+struct IndexSelection {
+  std::mutex mutex;
+  NearDuplicateIndex *index;
+
+  IndexSelection():
+    index(NULL) {}
+};
+
+static IndexSelection &Selection() {
+  static IndexSelection *selection = new IndexSelection;
+  return *selection;
+};
+
+static NearDuplicateIndex *Index() {
+  IndexSelection &selection = Selection();
+  std::lock_guard<std::mutex> lock(selection.mutex);
+  if (selection.index == NULL) {
+    // Default to 64MB BK-tree
+    selection.index = new BKTreeIndex(64 * 1024 * 1024);
+  }
+  return selection.index;
+};
+
+/*
+  Calculate 64-bit difference hash (dHash) of an image
+*/
+uint64_t Duplicates::Hash(vips::VImage input) {
+  // Get raw greyscale image data
+  vips::VImage grey = input.colourspace(VIPS_INTERPRETATION_B_W).extract_band(0).cast(VIPS_FORMAT_UCHAR);
+  const int width = grey.width();
+  const int height = grey.height();
+  size_t size;
+  unsigned char *data = static_cast<unsigned char*>(grey.write_to_memory(&size));
+
+  // Average brightness of each cell of a 9x8 grid
+  double sums[8][9] = {{0.0}};
+  int counts[8][9] = {{0}};
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      sums[y * 8 / height][x * 9 / width] += data[y * width + x];
+      counts[y * 8 / height][x * 9 / width]++;
+    }
+  }
+  g_free(data);
+
+  // Set one bit per pair of horizontally adjacent cells where brightness increases
+  uint64_t hash = 0;
+  for (int row = 0; row < 8; row++) {
+    for (int col = 0; col < 8; col++) {
+      const double current = sums[row][col] / std::max(1, counts[row][col]);
+      const double next = sums[row][col + 1] / std::max(1, counts[row][col + 1]);
+      hash = (hash << 1) | (current < next ? 1 : 0);
+    }
+  }
+  return hash;
+};
+
+/*
+  Find results of a near-duplicate image
+*/
+static bool Find(uint64_t hash, int maxDistance, int width, int height, NearDuplicateQuery query, NearDuplicate *match) {
+  query.aspectRatio = static_cast<double>(width) / static_cast<double>(height);
+  return Index()->Find(hash, maxDistance, query, match);
+};
+
+/*
+  Find the salient region of a near-duplicate image with the same aspect ratio
+*/
+bool Duplicates::FindRegion(uint64_t hash, int maxDistance, int width, int height, NearDuplicate *match) {
+  NearDuplicateQuery query;
+  query.region = true;
+  return Find(hash, maxDistance, width, height, query, match);
+};
+
+/*
+  Find the focal point of a near-duplicate image with the same aspect ratio
+*/
+bool Duplicates::FindPoint(uint64_t hash, int maxDistance, int width, int height, NearDuplicate *match) {
+  NearDuplicateQuery query;
+  query.point = true;
+  return Find(hash, maxDistance, width, height, query, match);
+};
+
+/*
+  Find the palette with this number of swatches of a near-duplicate image with the same aspect ratio
+*/
+bool Duplicates::FindPalette(uint64_t hash, int maxDistance, int width, int height, int swatches, NearDuplicate *match) {
+  NearDuplicateQuery query;
+  query.swatches = swatches;
+  return Find(hash, maxDistance, width, height, query, match);
+};
+
+/*
+  Store results for an image
+*/
+void Duplicates::Store(uint64_t hash, int width, int height, NearDuplicate entry) {
+  entry.aspectRatio = static_cast<double>(width) / static_cast<double>(height);
+  Index()->Store(hash, entry);
+};
+
+/*
+  Select the process-wide index, taking ownership of it.
+  Returns false, leaving the caller to own index, if an index is already in use.
+*/
+bool Duplicates::SetIndex(NearDuplicateIndex *index) {
+  IndexSelection &selection = Selection();
+  std::lock_guard<std::mutex> lock(selection.mutex);
+  if (selection.index != NULL) {
+    return false;
+  }
+  selection.index = index;
+  return true;
+};
@@ -0,0 +1,169 @@
+#ifndef SRC_DUPLICATES_H_
+#define SRC_DUPLICATES_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+/*
+  Results previously found for an image, relative to its dimensions
+*/
+struct NearDuplicate {
+  double aspectRatio;
+
+  // Salient region edges as a fraction of width or height
+  bool hasRegion;
+  double top, left, bottom, right;
+
+  // Focal point as a fraction of width and height
+  bool hasPoint;
+  double x, y;
+
+  // RGBA palette keyed by number of swatches
+  std::map<int, std::vector<unsigned char> > palettes;
+
+  NearDuplicate():
+    aspectRatio(0.0),
+    hasRegion(false),
+    top(0.0),
+    left(0.0),
+    bottom(0.0),
+    right(0.0),
+    hasPoint(false),
+    x(0.0),
+    y(0.0) {}
+
+  /*
+    Add results from another entry, replacing any of the same type
+  */
+  void Merge(const NearDuplicate &other);
+
+  /*
+    Is this entry for an image with the given aspect ratio?
+  */
+  bool HasAspectRatio(double aspectRatio) const;
+
+  /*
+    Approximate memory used by this entry, in bytes
+  */
+  size_t Bytes() const;
+};
+
+/*
+  Results wanted from a near-duplicate image
+*/
+struct NearDuplicateQuery {
+  double aspectRatio;
+  bool region;
+  bool point;
+  // Number of palette swatches, or 0 when no palette is wanted
+  int swatches;
+
+  NearDuplicateQuery():
+    aspectRatio(0.0),
+    region(false),
+    point(false),
+    swatches(0) {}
+
+  /*
+    Does this entry have the same aspect ratio and hold the wanted results?
+  */
+  bool IsMetBy(const NearDuplicate &entry) const;
+};
+
+/*
+  Interface to an index of results, searched by Hamming distance
+  between perceptual hashes, so alternatives can be selected with
+  Duplicates::SetIndex
+*/
+class NearDuplicateIndex {
+
+public:
+  virtual ~NearDuplicateIndex() {}
+
+  /*
+    Find the nearest entry that meets query within maxDistance bits of hash
+  */
+  virtual bool Find(uint64_t hash, int maxDistance, const NearDuplicateQuery &query, NearDuplicate *match) = 0;
+
+  /*
+    Store entry, merging with any existing entry for the same hash and aspect ratio
+  */
+  virtual void Store(uint64_t hash, const NearDuplicate &entry) = 0;
+
+};
+
+/*
+  In-memory BK-tree, evicting its least recently used entries when it exceeds maxBytes
+*/
+class BKTreeIndex : public NearDuplicateIndex {
+
+  struct Node {
+    uint64_t hash;
+    NearDuplicate entry;
+    uint64_t lastUsed;
+    std::map<int, Node*> children;
+  };
+
+  Node *root;
+  size_t bytes;
+  size_t maxBytes;
+  uint64_t clock;
+  std::mutex mutex;
+
+  void Search(Node *node, uint64_t hash, int maxDistance, const NearDuplicateQuery &query,
+    Node **nearest, int *nearestDistance);
+  void Insert(Node *node);
+  void Collect(Node *node, std::vector<Node*> *nodes);
+  void Evict();
+  static bool MoreRecentlyUsed(const Node *a, const Node *b);
+  void Delete(Node *node);
+
+public:
+  BKTreeIndex(size_t maxBytes);
+  ~BKTreeIndex();
+
+  bool Find(uint64_t hash, int maxDistance, const NearDuplicateQuery &query, NearDuplicate *match);
+  void Store(uint64_t hash, const NearDuplicate &entry);
+
+};
+
+class Duplicates {
+
+public:
+
+  /*
+    Calculate 64-bit difference hash (dHash) of an image
+  */
+  static uint64_t Hash(vips::VImage input);
+
+  /*
+    Find the salient region of a near-duplicate image with the same aspect ratio
+  */
+  static bool FindRegion(uint64_t hash, int maxDistance, int width, int height, NearDuplicate *match);
+
+  /*
+    Find the focal point of a near-duplicate image with the same aspect ratio
+  */
+  static bool FindPoint(uint64_t hash, int maxDistance, int width, int height, NearDuplicate *match);
+
+  /*
+    Find the palette with this number of swatches of a near-duplicate image with the same aspect ratio
+  */
+  static bool FindPalette(uint64_t hash, int maxDistance, int width, int height, int swatches, NearDuplicate *match);
+
+  /*
+    Store results for an image
+  */
+  static void Store(uint64_t hash, int width, int height, NearDuplicate entry);
+
+  /*
+    Select the process-wide index, taking ownership of it.
+    Returns false, leaving the caller to own index, if an index is already in use.
+  */
+  static bool SetIndex(NearDuplicateIndex *index);
+
+};
+
+#endif  // SRC_DUPLICATES_H_
@@ -0,0 +1,43 @@
+#include "nan.h"
+#include "environment.h"
+
+/*
+  Register cleanup hook for the environment currently loading the module
+*/
+Environment::Environment() {
+  this->loop = Nan::GetCurrentEventLoop();
+  this->closing = false;
+  this->pending = 0;
+#if NODE_MODULE_VERSION >= NODE_10_0_MODULE_VERSION
+  node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), Cleanup, this);
+#endif
+};
+
+/*
+  Run the event loop until every request in flight has finished and its worker
+  has been destroyed, so no work or handles remain when the loop is closed
+*/
+void Environment::Cleanup(void *arg) {
+  Environment *environment = static_cast<Environment*>(arg);
+  environment->closing = true;
+  while (environment->pending > 0) {
+    uv_run(environment->loop, UV_RUN_ONCE);
+  }
+  delete environment;
+};
+
+Environment *Environment::From(const Nan::FunctionCallbackInfo<v8::Value> &info) {
+  return static_cast<Environment*>(info.Data().As<v8::External>()->Value());
+};
+
+void Environment::Begin() {
+  pending++;
+};
+
+void Environment::End() {
+  pending--;
+};
+
+bool Environment::IsClosing() const {
+  return closing;
+};
@@ -0,0 +1,40 @@
+#ifndef SRC_ENVIRONMENT_H_
+#define SRC_ENVIRONMENT_H_
+
+#include "nan.h"
+
+/*
+  State of the Node.js environment, main thread or worker thread, that loaded the module.
+  When a worker thread is terminated, requests still in flight are allowed
+  to finish without calling back into JavaScript.
+*/
+class Environment {
+
+  uv_loop_t *loop;
+  bool closing;
+  int pending;
+
+  static void Cleanup(void *arg);
+
+public:
+  Environment();
+
+  /*
+    Environment of the function being called, as passed to its template
+  */
+  static Environment *From(const Nan::FunctionCallbackInfo<v8::Value> &info);
+
+  /*
+    Request started or finished, called from the constructor and destructor of each worker
+  */
+  void Begin();
+  void End();
+
+  /*
+    Is the environment being torn down, so JavaScript must no longer be called?
+  */
+  bool IsClosing() const;
+
+};
+
+#endif  // SRC_ENVIRONMENT_H_
@@ -1,14 +1,32 @@
+#include <algorithm>
 #include <vips/vips8>
 
 #include "mask.h"
 
+const int Mask::analysisEdge = 240;
+const int Mask::quickEdge = 64;
+
+/*
+  Scale of mask parameters for an image with the given longest edge
+*/
+double Mask::Scale(const int longestEdge) {
+  return static_cast<double>(longestEdge) / static_cast<double>(analysisEdge);
+};
+
+/*
+  Scale blur radius to match image dimensions, keeping a usable minimum
+*/
+static double ScaleSigma(double sigma, double scale) {
+  return std::max(0.5, sigma * scale);
+};
+
 /*
   Generate mask using Sobel operators
 */
-vips::VImage Mask::Edges(vips::VImage input) {
+vips::VImage Mask::Edges(vips::VImage input, double scale) {
 
   // Convert image to greyscale and apply small blur
-  vips::VImage grey = input.colourspace(VIPS_INTERPRETATION_B_W).gaussblur(2.0);
+  vips::VImage grey = input.colourspace(VIPS_INTERPRETATION_B_W).gaussblur(ScaleSigma(2.0, scale));
 
   // Create horizontal operator
   vips::VImage sobelX = vips::VImage::new_matrixv(3, 3,
@@ -37,10 +55,10 @@ vips::VImage Mask::Edges(vips::VImage input) {
 /*
   Generate mask of prominent colours
 */
-vips::VImage Mask::Colours(vips::VImage input) {
+vips::VImage Mask::Colours(vips::VImage input, double scale) {
 
   // Apply Gaussian blur
-  vips::VImage blurred = input.gaussblur(1.0);
+  vips::VImage blurred = input.gaussblur(ScaleSigma(1.0, scale));
 
   // Generate image containing the average colour
   const int shrunkWidth = input.width();
@@ -60,7 +78,8 @@ vips::VImage Mask::Colours(vips::VImage input) {
 /*
   Generate combined saliency mask
 */
-vips::VImage Mask::Saliency(vips::VImage input) {
-  // Keep pixels that appear in both masks and remove noise with 5x5 median filter
-  return (Edges(input) & Colours(input)).rank(5, 5, 12);
+vips::VImage Mask::Saliency(vips::VImage input, double scale) {
+  // Keep pixels that appear in both masks and remove noise with median filter, 5x5 at full scale
+  const int window = std::max(3, static_cast<int>(round(5.0 * scale)) | 1);
+  return (Edges(input, scale) & Colours(input, scale)).rank(window, window, window * window / 2);
 };
@@ -1,24 +1,40 @@
 #ifndef SRC_MASK_H_
 #define SRC_MASK_H_
 
+/*
+  Mask parameters are tuned for images with a longest edge of 240 pixels,
+  use scale to adjust them for smaller or larger images
+*/
 class Mask {
 
 public:
 
+  /*
+    Longest edge, in pixels, of images analysed for region and point,
+    and of the quick estimate of progressive mode
+  */
+  static const int analysisEdge;
+  static const int quickEdge;
+
+  /*
+    Scale of mask parameters for an image with the given longest edge
+  */
+  static double Scale(int longestEdge);
+
   /*
     Generate mask using Sobel operators
   */
-  static vips::VImage Edges(vips::VImage input);
+  static vips::VImage Edges(vips::VImage input, double scale = 1.0);
   
   /*
     Generate mask of prominent colours
   */
-  static vips::VImage Colours(vips::VImage input);
+  static vips::VImage Colours(vips::VImage input, double scale = 1.0);
 
   /*
     Generate combined saliency mask
   */
-  static vips::VImage Saliency(vips::VImage input);
+  static vips::VImage Saliency(vips::VImage input, double scale = 1.0);
   
 };
 
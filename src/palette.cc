@@ -1,8 +1,10 @@
 #include <vips/vips8>
 
 #include "nan.h"
+#include "environment.h"
 #include "exoquant/exoquant.h"
 #include "resizer.h"
+#include "duplicates.h"
 #include "palette.h"
 
 struct PaletteBaton {
@@ -11,9 +13,11 @@ struct PaletteBaton {
   size_t bufferLength;
   std::string file;
   int swatches;
+  int reuse;
 
   // Output
   unsigned char *palette;
+  bool reused;
   int duration;
   std::string err;
 
@@ -21,15 +25,22 @@ struct PaletteBaton {
     buffer(NULL),
     bufferLength(0),
     swatches(10),
+    reuse(-1),
     palette(NULL),
+    reused(false),
     duration(-1) {}
 };
 
 class PaletteWorker : public Nan::AsyncWorker {
 
 public:
-  PaletteWorker(Nan::Callback *callback, PaletteBaton *baton) : Nan::AsyncWorker(callback), baton(baton) {}
-  ~PaletteWorker() {}
+  PaletteWorker(Nan::Callback *callback, PaletteBaton *baton, Environment *environment) :
+    Nan::AsyncWorker(callback), baton(baton), environment(environment) {
+    environment->Begin();
+  }
+  ~PaletteWorker() {
+    environment->End();
+  }
 
   void Execute() {
     GTimer *timer = g_timer_new();
@@ -38,6 +49,11 @@ public:
     void *data = NULL;
     size_t size = 0;
 
+    // Perceptual hash and dimensions, when reusing results of near-duplicate images
+    uint64_t hash = 0;
+    int width = 0;
+    int height = 0;
+
     try {
 
       // Input
@@ -51,15 +67,30 @@ public:
         input = resizer.FromFile(baton->file);
       }
 
-      // Ensure sRGB with alpha channel
-      input = input.colourspace(VIPS_INTERPRETATION_sRGB);
-      if (input.bands() == 3) {
-        vips::VImage alpha = vips::VImage::black(1, 1).invert().zoom(input.width(), input.height());
-        input = input.bandjoin(alpha);
-      }
+      width = resizer.originalWidth;
+      height = resizer.originalHeight;
 
-      // Get raw image data
-      data = input.write_to_memory(&size);
+      // Reuse palette of a near-duplicate image, if any
+      NearDuplicate duplicate;
+      if (baton->reuse >= 0) {
+        hash = Duplicates::Hash(input);
+      }
+      if (baton->reuse >= 0 && Duplicates::FindPalette(hash, baton->reuse, width, height, baton->swatches, &duplicate)) {
+        const std::vector<unsigned char> &palette = duplicate.palettes[baton->swatches];
+        baton->palette = new unsigned char[baton->swatches * 4]();
+        std::copy(palette.begin(), palette.end(), baton->palette);
+        baton->reused = true;
+      } else {
+        // Ensure sRGB with alpha channel
+        input = input.colourspace(VIPS_INTERPRETATION_sRGB);
+        if (input.bands() == 3) {
+          vips::VImage alpha = vips::VImage::black(1, 1).invert().zoom(input.width(), input.height());
+          input = input.bandjoin(alpha);
+        }
+
+        // Get raw image data
+        data = input.write_to_memory(&size);
+      }
 
     } catch (vips::VError err) {
       baton->err = err.what();
@@ -77,6 +108,13 @@ public:
       exq_get_palette(exoquant, baton->palette, baton->swatches);
       exq_free(exoquant);
       g_free(data);
+
+      // Store results for reuse by near-duplicate images
+      if (baton->reuse >= 0) {
+        NearDuplicate entry;
+        entry.palettes[baton->swatches].assign(baton->palette, baton->palette + baton->swatches * 4);
+        Duplicates::Store(hash, width, height, entry);
+      }
     }
 
     // Store duration
@@ -91,6 +129,15 @@ public:
   void HandleOKCallback () {
     Nan::HandleScope();
 
+    // Environment is being torn down, so clean up without returning to JavaScript
+    if (environment->IsClosing()) {
+      if (baton->palette != NULL) {
+        delete baton->palette;
+      }
+      delete baton;
+      return;
+    }
+
     v8::Local<v8::Value> argv[2] = { Nan::Null(), Nan::Null() };
     if (!baton->err.empty()) {
       // Error
@@ -116,6 +163,7 @@ public:
       }
       Nan::Set(palette, Nan::New("swatches").ToLocalChecked(), swatches);
       Nan::Set(palette, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Integer>(baton->duration));
+      Nan::Set(palette, Nan::New("reused").ToLocalChecked(), Nan::New<v8::Boolean>(baton->reused));
       argv[1] = palette;
     }
     if (baton->palette != NULL) {
@@ -129,6 +177,7 @@ public:
 
 private:
   PaletteBaton *baton;
+  Environment *environment;
 };
 
 NAN_METHOD(palette) {
@@ -150,8 +199,10 @@ NAN_METHOD(palette) {
   }
   // Number of colour swatches
   baton->swatches = Nan::To<int32_t>(Nan::Get(options, Nan::New("swatches").ToLocalChecked()).ToLocalChecked()).FromJust();
+  // Maximum perceptual hash distance of near-duplicate results to reuse
+  baton->reuse = Nan::To<int32_t>(Nan::Get(options, Nan::New("reuse").ToLocalChecked()).ToLocalChecked()).FromJust();
 
   // Join queue for worker thread
   Nan::Callback *callback = new Nan::Callback(info[1].As<v8::Function>());
-  Nan::AsyncQueueWorker(new PaletteWorker(callback, baton));
+  Nan::AsyncQueueWorker(new PaletteWorker(callback, baton, Environment::From(info)));
 }
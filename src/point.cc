@@ -2,8 +2,10 @@
 #include <vips/vips8>
 
 #include "nan.h"
+#include "environment.h"
 #include "resizer.h"
 #include "mask.h"
+#include "duplicates.h"
 #include "point.h"
 
 struct PointBaton {
@@ -11,33 +13,53 @@ struct PointBaton {
   void *buffer;
   size_t bufferLength;
   std::string file;
+  bool progressive;
+  int reuse;
 
   // Output
   std::string err;
+  bool reused;
   int width, height, x, y, duration;
 
+  // Output of quick first phase, when progressive
+  bool quickReady, quickDelivered;
+  int quickX, quickY, quickDuration;
+
   PointBaton():
     buffer(NULL),
     bufferLength(0),
+    progressive(false),
+    reuse(-1),
+    reused(false),
     width(0),
     height(0),
     x(0),
     y(0),
-    duration(0) {}
+    duration(0),
+    quickReady(false),
+    quickDelivered(false),
+    quickX(0),
+    quickY(0),
+    quickDuration(0) {}
 };
 
-class PointWorker : public Nan::AsyncWorker {
+class PointWorker : public Nan::AsyncProgressWorker {
 
 public:
-  PointWorker(Nan::Callback *callback, PointBaton *baton) : Nan::AsyncWorker(callback), baton(baton) {}
-  ~PointWorker() {}
+  PointWorker(Nan::Callback *callback, PointBaton *baton, Environment *environment) :
+    Nan::AsyncProgressWorker(callback), baton(baton), environment(environment) {
+    environment->Begin();
+  }
+  ~PointWorker() {
+    environment->End();
+  }
 
-  void Execute() {
+  void Execute(const ExecutionProgress &progress) {
     GTimer *timer = g_timer_new();
     try {
 
-      // Input
-      ImageResizer resizer = ImageResizer(240);
+      // Input, starting with a tiny image when progressive
+      ImageResizer resizer = ImageResizer(baton->progressive ? Mask::quickEdge : Mask::analysisEdge);
       vips::VImage input;
       if (baton->buffer != NULL && baton->bufferLength > 0) {
         // From buffer
@@ -49,18 +71,44 @@ public:
       baton->width = resizer.originalWidth;
       baton->height = resizer.originalHeight;
 
-      // Generate saliency mask
-      vips::VImage mask = Mask::Saliency(input);
-
-      // Approximate focal point using the centre of gravity of pixels in the mask
-      vips::VImage projectRows, projectCols = mask.project(&projectRows);
-      size_t colBytes, rowBytes;
-      uint32_t *colData = reinterpret_cast<uint32_t*>(projectCols.write_to_memory(&colBytes));
-      baton->x = floor(1.0 / resizer.ratio * ElementAtMidpoint(colData, colBytes / 4));
-      g_free(colData);
-      uint32_t *rowData = reinterpret_cast<uint32_t*>(projectRows.write_to_memory(&rowBytes));
-      baton->y = floor(1.0 / resizer.ratio * ElementAtMidpoint(rowData, rowBytes / 4));
-      g_free(rowData);
+      // Reuse focal point of a near-duplicate image, if any
+      uint64_t hash = 0;
+      NearDuplicate duplicate;
+      if (baton->reuse >= 0) {
+        hash = Duplicates::Hash(input);
+      }
+      if (baton->reuse >= 0 && Duplicates::FindPoint(hash, baton->reuse, baton->width, baton->height, &duplicate)) {
+        baton->x = std::min(baton->width - 1, static_cast<int>(floor(duplicate.x * baton->width)));
+        baton->y = std::min(baton->height - 1, static_cast<int>(floor(duplicate.y * baton->height)));
+        baton->reused = true;
+      } else {
+        if (baton->progressive) {
+          // Quick estimate, with mask parameters scaled to match
+          try {
+            FocalPoint(input, resizer.ratio, Mask::Scale(Mask::quickEdge), &baton->quickX, &baton->quickY);
+            baton->quickDuration = ceil(g_timer_elapsed(timer, NULL) * 1000.0);
+            baton->quickReady = true;
+            // Notify main thread that the quick estimate is ready
+            progress.Send(reinterpret_cast<const char*>(&baton->quickReady), sizeof(baton->quickReady));
+          } catch (vips::VError err) {
+            // Refinement may still succeed
+            vips_error_clear();
+          }
+          // Refine, reusing the header of the already-open input
+          input = resizer.Reload(Mask::analysisEdge);
+        }
+
+        FocalPoint(input, resizer.ratio, 1.0, &baton->x, &baton->y);
+
+        // Store results for reuse by near-duplicate images
+        if (baton->reuse >= 0) {
+          NearDuplicate entry;
+          entry.hasPoint = true;
+          entry.x = (baton->x + 0.5) / baton->width;
+          entry.y = (baton->y + 0.5) / baton->height;
+          Duplicates::Store(hash, baton->width, baton->height, entry);
+        }
+      }
 
     } catch (vips::VError err) {
       baton->err = err.what();
@@ -75,22 +123,35 @@ public:
     vips_thread_shutdown();
   }
 
+  void HandleProgressCallback(const char *data, size_t size) {
+    // Nan opens no scope for progress callbacks
+    Nan::HandleScope scope;
+    if (environment->IsClosing()) {
+      return;
+    }
+    DeliverQuick();
+  }
+
   void HandleOKCallback () {
     Nan::HandleScope();
 
+    // Environment is being torn down, so clean up without returning to JavaScript
+    if (environment->IsClosing()) {
+      delete baton;
+      return;
+    }
+
+    // Ensure the quick estimate is always delivered first
+    if (baton->quickReady) {
+      DeliverQuick();
+    }
+
     v8::Local<v8::Value> argv[2] = { Nan::Null(), Nan::Null() };
     if (!baton->err.empty()) {
       // Error
       argv[0] = Nan::Error(baton->err.c_str());
     } else {
-      // Point Object
-      v8::Local<v8::Object> point = Nan::New<v8::Object>();
-      Nan::Set(point, Nan::New("x").ToLocalChecked(), Nan::New<v8::Integer>(baton->x));
-      Nan::Set(point, Nan::New("y").ToLocalChecked(), Nan::New<v8::Integer>(baton->y));
-      Nan::Set(point, Nan::New("width").ToLocalChecked(), Nan::New<v8::Integer>(baton->width));
-      Nan::Set(point, Nan::New("height").ToLocalChecked(), Nan::New<v8::Integer>(baton->height));
-      Nan::Set(point, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Integer>(baton->duration));
-      argv[1] = point;
+      argv[1] = PointObject(baton->x, baton->y, baton->duration, true);
     }
     delete baton;
 
@@ -100,6 +161,48 @@ public:
 
 private:
   PointBaton *baton;
+  Environment *environment;
+
+  /*
+    Approximate focal point using the centre of gravity of pixels in the saliency mask
+  */
+  void FocalPoint(vips::VImage input, double ratio, double scale, int *x, int *y) {
+    vips::VImage mask = Mask::Saliency(input, scale);
+    vips::VImage projectRows, projectCols = mask.project(&projectRows);
+    size_t colBytes, rowBytes;
+    uint32_t *colData = reinterpret_cast<uint32_t*>(projectCols.write_to_memory(&colBytes));
+    *x = floor(1.0 / ratio * ElementAtMidpoint(colData, colBytes / 4));
+    g_free(colData);
+    uint32_t *rowData = reinterpret_cast<uint32_t*>(projectRows.write_to_memory(&rowBytes));
+    *y = floor(1.0 / ratio * ElementAtMidpoint(rowData, rowBytes / 4));
+    g_free(rowData);
+  }
+
+  /*
+    Create Point Object
+  */
+  v8::Local<v8::Object> PointObject(int x, int y, int duration, bool final) {
+    v8::Local<v8::Object> point = Nan::New<v8::Object>();
+    Nan::Set(point, Nan::New("x").ToLocalChecked(), Nan::New<v8::Integer>(x));
+    Nan::Set(point, Nan::New("y").ToLocalChecked(), Nan::New<v8::Integer>(y));
+    Nan::Set(point, Nan::New("width").ToLocalChecked(), Nan::New<v8::Integer>(baton->width));
+    Nan::Set(point, Nan::New("height").ToLocalChecked(), Nan::New<v8::Integer>(baton->height));
+    Nan::Set(point, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Integer>(duration));
+    Nan::Set(point, Nan::New("final").ToLocalChecked(), Nan::New<v8::Boolean>(final));
+    Nan::Set(point, Nan::New("reused").ToLocalChecked(), Nan::New<v8::Boolean>(final && baton->reused));
+    return point;
+  }
+
+  /*
+    Return quick estimate to JavaScript, once only
+  */
+  void DeliverQuick() {
+    if (!baton->quickDelivered) {
+      baton->quickDelivered = true;
+      v8::Local<v8::Value> argv[2] = { Nan::Null(), PointObject(baton->quickX, baton->quickY, baton->quickDuration, false) };
+      callback->Call(2, argv);
+    }
+  }
 
   /*
     Find which element in a histogram contains the mid-point of the cumulative total
@@ -137,8 +240,12 @@ NAN_METHOD(point) {
     // Input is a filename
     baton->file = *Nan::Utf8String(Nan::Get(options, Nan::New("file").ToLocalChecked()).ToLocalChecked());
   }
+  // Quick estimate followed by refinement
+  baton->progressive = Nan::To<bool>(Nan::Get(options, Nan::New("progressive").ToLocalChecked()).ToLocalChecked()).FromJust();
+  // Maximum perceptual hash distance of near-duplicate results to reuse
+  baton->reuse = Nan::To<int32_t>(Nan::Get(options, Nan::New("reuse").ToLocalChecked()).ToLocalChecked()).FromJust();
 
   // Join queue for worker thread
   Nan::Callback *callback = new Nan::Callback(info[1].As<v8::Function>());
-  Nan::AsyncQueueWorker(new PointWorker(callback, baton));
+  Nan::AsyncQueueWorker(new PointWorker(callback, baton, Environment::From(info)));
 }
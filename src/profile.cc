@@ -0,0 +1,256 @@
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vips/vips8>
+#include <lcms2.h>
+
+#include "profile.h"
+
+/*
+  Parsed embedded profile and its transform to sRGB
+*/
+struct CachedProfile {
+  bool isSrgb;
+  bool isCached;
+  int bands;
+  cmsHTRANSFORM transform;
+
+  CachedProfile():
+    isSrgb(false),
+    isCached(false),
+    bands(0),
+    transform(NULL) {}
+};
+
+/*
+  Process-wide table of parsed profiles, keyed by hash of the profile ID or data.
+  Most images share a small number of profiles, so entries are never evicted
+  and further profiles are converted without being cached once it is full.
+*/
+struct ProfileCache {
+  std::mutex mutex;
+  // Profile ID or data, used to verify a hit, and the parsed profile
+  std::unordered_map<uint64_t, std::pair<std::string, CachedProfile> > profiles;
+};
+static const size_t profilesLimit = 64;
+
+/*
+  Deliberately leaked, as libuv threads may still be converting images at exit
+*/
+static ProfileCache &Profiles() {
+  static ProfileCache *cache = new ProfileCache;
+  return *cache;
+};
+
+/*
+  Free memory allocated by g_malloc
+  Used as the callback function for the "postclose" signal
+*/
+static void FreeMemory(VipsObject *object, void *data) {
+  g_free(data);
+};
+
+/*
+  Does this profile describe sRGB primaries and tone curves?
+*/
+static bool IsSrgbEquivalent(cmsHPROFILE profile, cmsHPROFILE srgbProfile) {
+  if (cmsGetColorSpace(profile) != cmsSigRgbData || cmsIsTag(profile, cmsSigAToB0Tag)) {
+    return false;
+  }
+  const cmsTagSignature colorants[] = { cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+  const cmsTagSignature curves[] = { cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+  for (int i = 0; i < 3; i++) {
+    // Primaries must match to within rounding of the stored values
+    const cmsCIEXYZ *actualXYZ = static_cast<cmsCIEXYZ*>(cmsReadTag(profile, colorants[i]));
+    const cmsCIEXYZ *expectedXYZ = static_cast<cmsCIEXYZ*>(cmsReadTag(srgbProfile, colorants[i]));
+    if (actualXYZ == NULL || expectedXYZ == NULL ||
+      fabs(actualXYZ->X - expectedXYZ->X) > 0.002 ||
+      fabs(actualXYZ->Y - expectedXYZ->Y) > 0.002 ||
+      fabs(actualXYZ->Z - expectedXYZ->Z) > 0.002) {
+      return false;
+    }
+    // Tone curves must match to within less than one 8-bit level
+    const cmsToneCurve *actualCurve = static_cast<cmsToneCurve*>(cmsReadTag(profile, curves[i]));
+    const cmsToneCurve *expectedCurve = static_cast<cmsToneCurve*>(cmsReadTag(srgbProfile, curves[i]));
+    if (actualCurve == NULL || expectedCurve == NULL) {
+      return false;
+    }
+    for (int step = 0; step <= 16; step++) {
+      const cmsFloat32Number value = step / 16.0f;
+      if (fabs(cmsEvalToneCurveFloat(actualCurve, value) - cmsEvalToneCurveFloat(expectedCurve, value)) > 0.002) {
+        return false;
+      }
+    }
+  }
+  return true;
+};
+
+/*
+  Parse profile and create its transform to 8-bit sRGB
+*/
+static CachedProfile CreateProfile(const void *data, size_t length) {
+  CachedProfile cached;
+  cmsHPROFILE profile = cmsOpenProfileFromMem(data, length);
+  if (profile == NULL) {
+    return cached;
+  }
+  // Each thread uses its own sRGB profile, as lcms2 profiles are not safe to share
+  cmsHPROFILE srgbProfile = cmsCreate_sRGBProfile();
+  if (IsSrgbEquivalent(profile, srgbProfile)) {
+    cached.isSrgb = true;
+  } else {
+    cmsUInt32Number format = 0;
+    switch (cmsGetColorSpace(profile)) {
+      case cmsSigRgbData:
+        format = TYPE_RGB_8;
+        cached.bands = 3;
+        break;
+      case cmsSigCmykData:
+        format = TYPE_CMYK_8;
+        cached.bands = 4;
+        break;
+      case cmsSigGrayData:
+        format = TYPE_GRAY_8;
+        cached.bands = 1;
+        break;
+      default:
+        break;
+    }
+    if (format != 0) {
+      // Match the default rendering intent of libvips' icc_import
+      cached.transform = cmsCreateTransform(profile, format, srgbProfile, TYPE_RGB_8,
+        INTENT_RELATIVE_COLORIMETRIC, 0);
+    }
+  }
+  cmsCloseProfile(srgbProfile);
+  cmsCloseProfile(profile);
+  return cached;
+};
+
+/*
+  Identify a profile by the MD5 profile ID in its header, when set, otherwise by all of its data
+*/
+static std::pair<const char*, size_t> ProfileIdentity(const void *data, size_t length) {
+  const char *bytes = static_cast<const char*>(data);
+  if (length >= 100) {
+    static const char zeroId[16] = { 0 };
+    if (memcmp(bytes + 84, zeroId, 16) != 0) {
+      return std::make_pair(bytes + 84, static_cast<size_t>(16));
+    }
+  }
+  return std::make_pair(bytes, length);
+};
+
+/*
+  64-bit FNV-1a hash of the profile identity and length, without copying it
+*/
+static uint64_t ProfileKey(std::pair<const char*, size_t> identity, size_t length) {
+  uint64_t hash = 14695981039346656037ULL ^ length;
+  for (size_t i = 0; i < identity.second; i++) {
+    hash = (hash ^ static_cast<unsigned char>(identity.first[i])) * 1099511628211ULL;
+  }
+  return hash;
+};
+
+/*
+  Find profile in cache, parsing and adding it if not present
+*/
+static CachedProfile LookupProfile(const void *data, size_t length) {
+  const std::pair<const char*, size_t> identity = ProfileIdentity(data, length);
+  const uint64_t key = ProfileKey(identity, length);
+  ProfileCache &cache = Profiles();
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    std::unordered_map<uint64_t, std::pair<std::string, CachedProfile> >::iterator it = cache.profiles.find(key);
+    if (it != cache.profiles.end() && it->second.first.size() == identity.second &&
+      memcmp(it->second.first.data(), identity.first, identity.second) == 0) {
+      return it->second.second;
+    }
+  }
+
+  // Parse outside the lock, so a new profile does not stall other threads
+  CachedProfile cached = CreateProfile(data, length);
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  std::unordered_map<uint64_t, std::pair<std::string, CachedProfile> >::iterator it = cache.profiles.find(key);
+  if (it == cache.profiles.end()) {
+    if (cache.profiles.size() < profilesLimit) {
+      cached.isCached = true;
+      cache.profiles[key] = std::make_pair(std::string(identity.first, identity.second), cached);
+    }
+  } else if (it->second.first.size() == identity.second &&
+    memcmp(it->second.first.data(), identity.first, identity.second) == 0) {
+    // Another thread added the same profile first
+    if (cached.transform != NULL) {
+      cmsDeleteTransform(cached.transform);
+    }
+    return it->second.second;
+  }
+  // On a hash collision, keep the existing entry and convert without caching
+  return cached;
+};
+
+/*
+  Convert an image with an embedded ICC profile to sRGB
+*/
+vips::VImage Profile::ToSrgb(vips::VImage input) {
+  size_t length = 0;
+  const void *data = input.get_blob(VIPS_META_ICC_NAME, &length);
+  CachedProfile profile = LookupProfile(data, length);
+
+  // Fast path: pixel values are already sRGB
+  if (profile.isSrgb) {
+    return input;
+  }
+
+  // Let libvips handle less common profiles, sample formats and band layouts
+  const bool hasAlpha = input.bands() == profile.bands + 1 && vips_image_hasalpha(input.get_image());
+  if (profile.transform == NULL || input.format() != VIPS_FORMAT_UCHAR ||
+    (input.bands() != profile.bands && !hasAlpha)) {
+    if (profile.transform != NULL && !profile.isCached) {
+      cmsDeleteTransform(profile.transform);
+    }
+    return input.icc_import(vips::VImage::option()->set("embedded", TRUE));
+  }
+
+  // Get raw image data
+  size_t size = 0;
+  unsigned char *in = static_cast<unsigned char*>(input.write_to_memory(&size));
+  const int width = input.width();
+  const int height = input.height();
+  const int bands = input.bands();
+  const int extraBands = bands - profile.bands;
+  const size_t pixels = static_cast<size_t>(width) * height;
+  unsigned char *out = static_cast<unsigned char*>(g_malloc(pixels * (3 + extraBands)));
+
+  // Transform colour bands, then copy any alpha band
+  if (extraBands == 0) {
+    cmsDoTransform(profile.transform, in, out, pixels);
+  } else {
+    unsigned char *colour = new unsigned char[pixels * profile.bands];
+    unsigned char *srgb = new unsigned char[pixels * 3];
+    for (size_t i = 0; i < pixels; i++) {
+      memcpy(colour + i * profile.bands, in + i * bands, profile.bands);
+    }
+    cmsDoTransform(profile.transform, colour, srgb, pixels);
+    for (size_t i = 0; i < pixels; i++) {
+      memcpy(out + i * (3 + extraBands), srgb + i * 3, 3);
+      memcpy(out + i * (3 + extraBands) + 3, in + i * bands + profile.bands, extraBands);
+    }
+    delete[] colour;
+    delete[] srgb;
+  }
+  g_free(in);
+  if (!profile.isCached) {
+    cmsDeleteTransform(profile.transform);
+  }
+
+  // Wrap output, listening for "postclose" signal to free it
+  vips::VImage output = vips::VImage::new_from_memory(out, pixels * (3 + extraBands),
+    width, height, 3 + extraBands, VIPS_FORMAT_UCHAR);
+  g_signal_connect(output.get_image(), "postclose", G_CALLBACK(FreeMemory), out);
+  return output.copy(vips::VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB));
+};
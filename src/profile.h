@@ -0,0 +1,15 @@
+#ifndef SRC_PROFILE_H_
+#define SRC_PROFILE_H_
+
+class Profile {
+
+public:
+
+  /*
+    Convert an image with an embedded ICC profile to sRGB
+  */
+  static vips::VImage ToSrgb(vips::VImage input);
+
+};
+
+#endif  // SRC_PROFILE_H_
@@ -1,44 +1,68 @@
 #include <vips/vips8>
 
 #include "nan.h"
+#include "environment.h"
 #include "region.h"
 #include "resizer.h"
 #include "mask.h"
+#include "duplicates.h"
 
 struct RegionBaton {
   // Input
   void *buffer;
   size_t bufferLength;
   std::string file;
+  bool progressive;
+  int reuse;
 
   // Output
   std::string err;
+  bool reused;
   int width, height, top, left, bottom, right, duration;
 
+  // Output of quick first phase, when progressive
+  bool quickReady, quickDelivered;
+  int quickTop, quickLeft, quickBottom, quickRight, quickDuration;
+
   RegionBaton():
     buffer(NULL),
     bufferLength(0),
+    progressive(false),
+    reuse(-1),
+    reused(false),
     width(0),
     height(0),
     top(0),
     left(0),
     bottom(0),
     right(0),
-    duration(0) {}
+    duration(0),
+    quickReady(false),
+    quickDelivered(false),
+    quickTop(0),
+    quickLeft(0),
+    quickBottom(0),
+    quickRight(0),
+    quickDuration(0) {}
 };
 
-class RegionWorker : public Nan::AsyncWorker {
+class RegionWorker : public Nan::AsyncProgressWorker {
 
 public:
-  RegionWorker(Nan::Callback *callback, RegionBaton *baton) : Nan::AsyncWorker(callback), baton(baton) {}
-  ~RegionWorker() {}
+  RegionWorker(Nan::Callback *callback, RegionBaton *baton, Environment *environment) :
+    Nan::AsyncProgressWorker(callback), baton(baton), environment(environment) {
+    environment->Begin();
+  }
+  ~RegionWorker() {
+    environment->End();
+  }
 
-  void Execute() {
+  void Execute(const ExecutionProgress &progress) {
     GTimer *timer = g_timer_new();
     try {
 
-      // Input
-      ImageResizer resizer = ImageResizer(240);
+      // Input, starting with a tiny image when progressive
+      ImageResizer resizer = ImageResizer(baton->progressive ? Mask::quickEdge : Mask::analysisEdge);
       vips::VImage input;
       if (baton->buffer != NULL && baton->bufferLength > 0) {
         // From buffer
@@ -50,34 +74,49 @@ public:
       baton->width = resizer.originalWidth;
       baton->height = resizer.originalHeight;
 
-      // Generate saliency mask
-      vips::VImage mask = Mask::Saliency(input);
-
-      // Measure distance to first non-zero pixel along top and left edges
-      vips::VImage profileLeft, profileTop = mask.profile(&profileLeft);
-      const int top = floor(1.0 / resizer.ratio * profileTop.min());
-      const int left = floor(1.0 / resizer.ratio * profileLeft.min());
-
-      // Verify mask is non-empty
-      if (top < resizer.originalHeight && left < resizer.originalWidth) {
-        // Measure distance to first non-zero pixel along bottom and right edges
-        vips::VImage profileRight, profileBottom = mask.rot(VIPS_ANGLE_D180).profile(&profileRight);
-        const int bottom = resizer.originalHeight - 1 - floor(1.0 / resizer.ratio * profileBottom.min());
-        const int right = resizer.originalWidth - 1 - floor(1.0 / resizer.ratio * profileRight.min());
-
-        // Verify area of region is greater than 1/16 of original image area
-        const int regionArea = (bottom - top) * (right - left);
-        if (regionArea > resizer.originalWidth * resizer.originalHeight / 16.0) {
-          // Store results
-          baton->top = top;
-          baton->left = left;
-          baton->bottom = bottom;
-          baton->right = right;
-        } else {
-          baton->err = "Salient region was too small";
-        }
+      // Reuse salient region of a near-duplicate image, if any
+      uint64_t hash = 0;
+      NearDuplicate duplicate;
+      if (baton->reuse >= 0) {
+        hash = Duplicates::Hash(input);
+      }
+      if (baton->reuse >= 0 && Duplicates::FindRegion(hash, baton->reuse, baton->width, baton->height, &duplicate)) {
+        baton->top = std::min(baton->height - 1, static_cast<int>(floor(duplicate.top * baton->height)));
+        baton->left = std::min(baton->width - 1, static_cast<int>(floor(duplicate.left * baton->width)));
+        baton->bottom = std::min(baton->height - 1, static_cast<int>(floor(duplicate.bottom * baton->height)));
+        baton->right = std::min(baton->width - 1, static_cast<int>(floor(duplicate.right * baton->width)));
+        baton->reused = true;
       } else {
-        baton->err = "Could not determine salient region";
+        if (baton->progressive) {
+          // Quick estimate, with mask parameters scaled to match
+          try {
+            if (SalientRegion(input, resizer, Mask::Scale(Mask::quickEdge),
+              &baton->quickTop, &baton->quickLeft, &baton->quickBottom, &baton->quickRight).empty()) {
+              baton->quickDuration = ceil(g_timer_elapsed(timer, NULL) * 1000.0);
+              baton->quickReady = true;
+              // Notify main thread that the quick estimate is ready
+              progress.Send(reinterpret_cast<const char*>(&baton->quickReady), sizeof(baton->quickReady));
+            }
+          } catch (vips::VError err) {
+            // Refinement may still succeed
+            vips_error_clear();
+          }
+          // Refine, reusing the header of the already-open input
+          input = resizer.Reload(Mask::analysisEdge);
+        }
+
+        baton->err = SalientRegion(input, resizer, 1.0, &baton->top, &baton->left, &baton->bottom, &baton->right);
+
+        // Store results for reuse by near-duplicate images
+        if (baton->reuse >= 0 && baton->err.empty()) {
+          NearDuplicate entry;
+          entry.hasRegion = true;
+          entry.top = (baton->top + 0.5) / baton->height;
+          entry.left = (baton->left + 0.5) / baton->width;
+          entry.bottom = (baton->bottom + 0.5) / baton->height;
+          entry.right = (baton->right + 0.5) / baton->width;
+          Duplicates::Store(hash, baton->width, baton->height, entry);
+        }
       }
     } catch (vips::VError err) {
       baton->err = err.what();
@@ -92,24 +131,35 @@ public:
     vips_thread_shutdown();
   }
 
+  void HandleProgressCallback(const char *data, size_t size) {
+    // Nan opens no scope for progress callbacks
+    Nan::HandleScope scope;
+    if (environment->IsClosing()) {
+      return;
+    }
+    DeliverQuick();
+  }
+
   void HandleOKCallback () {
     Nan::HandleScope();
 
+    // Environment is being torn down, so clean up without returning to JavaScript
+    if (environment->IsClosing()) {
+      delete baton;
+      return;
+    }
+
+    // Ensure the quick estimate is always delivered first
+    if (baton->quickReady) {
+      DeliverQuick();
+    }
+
     v8::Local<v8::Value> argv[2] = { Nan::Null(), Nan::Null() };
     if (!baton->err.empty()) {
       // Error
       argv[0] = Nan::Error(baton->err.c_str());
     } else {
-      // Region Object
-      v8::Local<v8::Object> region = Nan::New<v8::Object>();
-      Nan::Set(region, Nan::New("top").ToLocalChecked(), Nan::New<v8::Integer>(baton->top));
-      Nan::Set(region, Nan::New("left").ToLocalChecked(), Nan::New<v8::Integer>(baton->left));
-      Nan::Set(region, Nan::New("bottom").ToLocalChecked(), Nan::New<v8::Integer>(baton->bottom));
-      Nan::Set(region, Nan::New("right").ToLocalChecked(), Nan::New<v8::Integer>(baton->right));
-      Nan::Set(region, Nan::New("width").ToLocalChecked(), Nan::New<v8::Integer>(baton->width));
-      Nan::Set(region, Nan::New("height").ToLocalChecked(), Nan::New<v8::Integer>(baton->height));
-      Nan::Set(region, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Integer>(baton->duration));
-      argv[1] = region;
+      argv[1] = RegionObject(baton->top, baton->left, baton->bottom, baton->right, baton->duration, true);
     }
     delete baton;
 
@@ -119,6 +169,73 @@ public:
 
 private:
   RegionBaton *baton;
+  Environment *environment;
+
+  /*
+    Find edges of the salient region, returning an error message on failure
+  */
+  std::string SalientRegion(vips::VImage input, const ImageResizer &resizer, double scale,
+    int *regionTop, int *regionLeft, int *regionBottom, int *regionRight) {
+    // Generate saliency mask
+    vips::VImage mask = Mask::Saliency(input, scale);
+
+    // Measure distance to first non-zero pixel along top and left edges
+    vips::VImage profileLeft, profileTop = mask.profile(&profileLeft);
+    const int top = floor(1.0 / resizer.ratio * profileTop.min());
+    const int left = floor(1.0 / resizer.ratio * profileLeft.min());
+
+    // Verify mask is non-empty
+    if (top < resizer.originalHeight && left < resizer.originalWidth) {
+      // Measure distance to first non-zero pixel along bottom and right edges
+      vips::VImage profileRight, profileBottom = mask.rot(VIPS_ANGLE_D180).profile(&profileRight);
+      const int bottom = resizer.originalHeight - 1 - floor(1.0 / resizer.ratio * profileBottom.min());
+      const int right = resizer.originalWidth - 1 - floor(1.0 / resizer.ratio * profileRight.min());
+
+      // Verify area of region is greater than 1/16 of original image area
+      const int regionArea = (bottom - top) * (right - left);
+      if (regionArea > resizer.originalWidth * resizer.originalHeight / 16.0) {
+        // Store results
+        *regionTop = top;
+        *regionLeft = left;
+        *regionBottom = bottom;
+        *regionRight = right;
+        return std::string();
+      } else {
+        return "Salient region was too small";
+      }
+    } else {
+      return "Could not determine salient region";
+    }
+  }
+
+  /*
+    Create Region Object
+  */
+  v8::Local<v8::Object> RegionObject(int top, int left, int bottom, int right, int duration, bool final) {
+    v8::Local<v8::Object> region = Nan::New<v8::Object>();
+    Nan::Set(region, Nan::New("top").ToLocalChecked(), Nan::New<v8::Integer>(top));
+    Nan::Set(region, Nan::New("left").ToLocalChecked(), Nan::New<v8::Integer>(left));
+    Nan::Set(region, Nan::New("bottom").ToLocalChecked(), Nan::New<v8::Integer>(bottom));
+    Nan::Set(region, Nan::New("right").ToLocalChecked(), Nan::New<v8::Integer>(right));
+    Nan::Set(region, Nan::New("width").ToLocalChecked(), Nan::New<v8::Integer>(baton->width));
+    Nan::Set(region, Nan::New("height").ToLocalChecked(), Nan::New<v8::Integer>(baton->height));
+    Nan::Set(region, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Integer>(duration));
+    Nan::Set(region, Nan::New("final").ToLocalChecked(), Nan::New<v8::Boolean>(final));
+    Nan::Set(region, Nan::New("reused").ToLocalChecked(), Nan::New<v8::Boolean>(final && baton->reused));
+    return region;
+  }
+
+  /*
+    Return quick estimate to JavaScript, once only
+  */
+  void DeliverQuick() {
+    if (!baton->quickDelivered) {
+      baton->quickDelivered = true;
+      v8::Local<v8::Value> argv[2] = { Nan::Null(), RegionObject(baton->quickTop, baton->quickLeft,
+        baton->quickBottom, baton->quickRight, baton->quickDuration, false) };
+      callback->Call(2, argv);
+    }
+  }
 };
 
 NAN_METHOD(region) {
@@ -138,8 +255,12 @@ NAN_METHOD(region) {
     // Input is a filename
     baton->file = *Nan::Utf8String(Nan::Get(options, Nan::New("file").ToLocalChecked()).ToLocalChecked());
   }
+  // Quick estimate followed by refinement
+  baton->progressive = Nan::To<bool>(Nan::Get(options, Nan::New("progressive").ToLocalChecked()).ToLocalChecked()).FromJust();
+  // Maximum perceptual hash distance of near-duplicate results to reuse
+  baton->reuse = Nan::To<int32_t>(Nan::Get(options, Nan::New("reuse").ToLocalChecked()).ToLocalChecked()).FromJust();
 
   // Join queue for worker thread
   Nan::Callback *callback = new Nan::Callback(info[1].As<v8::Function>());
-  Nan::AsyncQueueWorker(new RegionWorker(callback, baton));
+  Nan::AsyncQueueWorker(new RegionWorker(callback, baton, Environment::From(info)));
 }
@@ -1,12 +1,15 @@
 #include <vips/vips8>
 
 #include "resizer.h"
+#include "profile.h"
 
 /*
   Resize the longest edge of the image to longestEdge pixels
 */
 ImageResizer::ImageResizer(const int longestEdge) {
   this->longestEdge = longestEdge;
+  this->buffer = NULL;
+  this->bufferLength = 0;
   this->originalWidth = 0;
   this->originalHeight = 0;
   this->ratio = 1.0;
@@ -26,6 +29,14 @@ vips::VImage ImageResizer::FromBuffer(void *buffer, size_t bufferLength) {
   return LoadAndResize(std::string(), buffer, bufferLength);
 };
 
+/*
+  Load the same image again, resizing its longest edge to longestEdge pixels
+*/
+vips::VImage ImageResizer::Reload(const int longestEdge) {
+  this->longestEdge = longestEdge;
+  return LoadAndResize(this->file, this->buffer, this->bufferLength);
+};
+
 /*
   Delete input char[] buffer and notify V8 of memory deallocation
   Used as the callback function for the "postclose" signal
@@ -40,26 +51,30 @@ static void DeleteBuffer(VipsObject *object, char *buffer) {
   All the resize logic
 */
 vips::VImage ImageResizer::LoadAndResize(std::string file, void *buffer, size_t bufferLength) {
-  // Input
-  vips::VImage input;
-  std::string loader;
-  if (buffer != NULL && bufferLength > 0) {
-    // From buffer
-    loader = vips_foreign_find_load_buffer(buffer, bufferLength);
-    input = vips::VImage::new_from_buffer(buffer, bufferLength, NULL,
-      vips::VImage::option()->set("access", VIPS_ACCESS_RANDOM));
-    // Listen for "postclose" signal to delete input buffer
-    g_signal_connect(input.get_image(), "postclose", G_CALLBACK(DeleteBuffer), buffer);
-  } else {
-    // From file
-    loader = vips_foreign_find_load(file.c_str());
-    input = vips::VImage::new_from_file(file.c_str(),
-      vips::VImage::option()->set("access", VIPS_ACCESS_RANDOM));
-  }
+  // Input, reusing the header from a previous load, if any
+  if (this->loader.empty()) {
+    this->file = file;
+    this->buffer = buffer;
+    this->bufferLength = bufferLength;
+    if (buffer != NULL && bufferLength > 0) {
+      // From buffer
+      this->loader = vips_foreign_find_load_buffer(buffer, bufferLength);
+      this->header = vips::VImage::new_from_buffer(buffer, bufferLength, NULL,
+        vips::VImage::option()->set("access", VIPS_ACCESS_RANDOM));
+      // Listen for "postclose" signal to delete input buffer
+      g_signal_connect(this->header.get_image(), "postclose", G_CALLBACK(DeleteBuffer), buffer);
+    } else {
+      // From file
+      this->loader = vips_foreign_find_load(file.c_str());
+      this->header = vips::VImage::new_from_file(file.c_str(),
+        vips::VImage::option()->set("access", VIPS_ACCESS_RANDOM));
+    }
 
-  // Store original image dimensions
-  this->originalWidth = input.width();
-  this->originalHeight = input.height();
+    // Store original image dimensions
+    this->originalWidth = this->header.width();
+    this->originalHeight = this->header.height();
+  }
+  vips::VImage input = this->header;
 
   // Which edge is the longest?
   const int longestEdge = std::max(this->originalWidth, this->originalHeight);
@@ -69,7 +84,7 @@ vips::VImage ImageResizer::LoadAndResize(std::string file, void *buffer, size_t
   double affineRatio = ratio;
 
   // Shrink-on-load JPEG
-  if (loader == "VipsForeignLoadJpegFile" && longestEdge >= 2 * this->longestEdge) {
+  if (this->loader == "VipsForeignLoadJpegFile" && longestEdge >= 2 * this->longestEdge) {
     int shrinkOnLoad = 2;
     if (longestEdge >= 8 * this->longestEdge) {
       shrinkOnLoad = 8;
@@ -95,12 +110,13 @@ vips::VImage ImageResizer::LoadAndResize(std::string file, void *buffer, size_t
     }
   }
 
-  // Import embedded colour profile, if any
-  if (input.get_typeof(VIPS_META_ICC_NAME) > 0) {
-    input = input.icc_import(vips::VImage::option()->set("embedded", TRUE));
-  }
-
   // Shrink via affine reduction
-  return input.resize(affineRatio, vips::VImage::option()->set("interpolate",
+  input = input.resize(affineRatio, vips::VImage::option()->set("interpolate",
     vips::VInterpolate::new_from_name("bilinear")));
+
+  // Convert embedded colour profile, if any, to sRGB on the reduced image
+  if (input.get_typeof(VIPS_META_ICC_NAME) > 0) {
+    input = Profile::ToSrgb(input);
+  }
+  return input;
 };
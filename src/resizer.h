@@ -5,6 +5,15 @@ class ImageResizer {
 
   int longestEdge;
 
+  /*
+    Source and header of the image, kept to allow it to be reloaded
+  */
+  std::string file;
+  void *buffer;
+  size_t bufferLength;
+  std::string loader;
+  vips::VImage header;
+
   vips::VImage LoadAndResize(std::string file, void *buffer, size_t bufferLength);
 
 public:
@@ -34,6 +43,11 @@ public:
   */
   vips::VImage FromBuffer(void *buffer, size_t bufferLength);
 
+  /*
+    Load the same image again, resizing its longest edge to longestEdge pixels
+  */
+  vips::VImage Reload(int longestEdge);
+
 };
 
 #endif  // SRC_RESIZER_H_
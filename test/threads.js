@@ -0,0 +1,94 @@
+'use strict';
+
+// Load the module in multiple worker_threads, including workers terminated mid-request
+// Requires Node.js with worker_threads support
+
+var path = require('path');
+var assert = require('assert');
+
+var threads;
+try {
+  threads = require('worker_threads');
+} catch (err) {
+  console.log('Skipped worker_threads tests as they are unsupported');
+  return;
+}
+
+var attention = require('../');
+
+var fixtureFile = path.join(__dirname, 'divided-attention.jpg');
+
+if (!threads.isMainThread) {
+  if (threads.workerData.terminate) {
+    // Start requests, including progressive, then report so the main thread terminates this worker
+    attention(fixtureFile).palette(function() {});
+    attention(fixtureFile).progressive().region(function() {});
+    attention(fixtureFile).point(function() {});
+    threads.parentPort.postMessage('started');
+  } else {
+    // Run each request to completion
+    attention(fixtureFile).swatches(1).palette(function(err, palette) {
+      if (err) throw err;
+      attention(fixtureFile).region(function(err, region) {
+        if (err) throw err;
+        attention(fixtureFile).point(function(err, point) {
+          if (err) throw err;
+          threads.parentPort.postMessage({
+            palette: palette.swatches[0].css,
+            region: [region.top, region.left, region.bottom, region.right, region.width, region.height],
+            point: [point.x, point.y, point.width, point.height]
+          });
+        });
+      });
+    });
+  }
+  return;
+}
+
+var startWorker = function(terminate, onMessage) {
+  var worker = new threads.Worker(__filename, { workerData: { terminate: terminate } });
+  worker.on('error', function(err) {
+    throw err;
+  });
+  worker.on('message', function(message) {
+    onMessage(worker, message);
+  });
+  return worker;
+};
+
+// Two workers loaded at the same time must give the same results as each other
+var results = [];
+[1, 2].forEach(function() {
+  startWorker(false, function(worker, result) {
+    assert.strictEqual(495, result.region[4]);
+    assert.strictEqual(599, result.point[3]);
+    results.push(result);
+    if (results.length === 2) {
+      assert.deepEqual(results[0], results[1]);
+    }
+  });
+});
+
+// Workers terminated while requests are in flight must exit cleanly
+var terminated = 0;
+[1, 2].forEach(function() {
+  var worker = startWorker(true, function(worker) {
+    worker.terminate();
+  });
+  worker.on('exit', function() {
+    terminated++;
+  });
+});
+
+// The main thread can still use the module afterwards
+setTimeout(function() {
+  attention(fixtureFile).region(function(err, region) {
+    if (err) throw err;
+    assert.strictEqual(495, region.width);
+  });
+}, 100);
+
+process.on('exit', function() {
+  assert.strictEqual(2, results.length);
+  assert.strictEqual(2, terminated);
+});
@@ -76,4 +76,125 @@ var fixtureData = fs.readFileSync(fixtureFile);
     assert.strictEqual(599, point.height);
   });
 
+  // Quick estimate first, then refined result
+  var regionCalls = [];
+  attention(fixture).progressive().region(function(err, region) {
+    if (err) throw err;
+    regionCalls.push(region.final);
+    assert.strictEqual(regionCalls.length === 2, region.final);
+    assert.strictEqual(495, region.width);
+    assert.strictEqual(599, region.height);
+    assert.strictEqual(true, region.top >= 0 && region.top < region.bottom && region.bottom < 599);
+    assert.strictEqual(true, region.left >= 0 && region.left < region.right && region.right < 495);
+  });
+
+  var pointCalls = [];
+  attention(fixture).progressive().point(function(err, point) {
+    if (err) throw err;
+    pointCalls.push(point.final);
+    assert.strictEqual(pointCalls.length === 2, point.final);
+    assert.strictEqual(495, point.width);
+    assert.strictEqual(599, point.height);
+    assert.strictEqual(true, point.x >= 0 && point.x < 495);
+    assert.strictEqual(true, point.y >= 0 && point.y < 599);
+  });
+
+  process.on('exit', function() {
+    assert.deepEqual([false, true], regionCalls);
+    assert.deepEqual([false, true], pointCalls);
+  });
+});
+
+// Near-duplicate: smaller, lower quality re-encode with the same aspect ratio
+// Not a near-duplicate: mirrored copy
+var smallFile = path.join(__dirname, 'divided-attention-small.jpg');
+var flopFile = path.join(__dirname, 'divided-attention-flop.jpg');
+var rescale = function(value, from, to) {
+  return Math.min(to - 1, Math.floor((value + 0.5) / from * to));
+};
+
+attention(fixtureFile).reuse(8).region(function(err, region) {
+  if (err) throw err;
+  assert.strictEqual(false, region.reused);
+  attention(smallFile).reuse(8).region(function(err, reused) {
+    if (err) throw err;
+    assert.strictEqual(true, reused.reused);
+    assert.strictEqual(248, reused.width);
+    assert.strictEqual(300, reused.height);
+    assert.strictEqual(rescale(region.top, 599, 300), reused.top);
+    assert.strictEqual(rescale(region.left, 495, 248), reused.left);
+    assert.strictEqual(rescale(region.bottom, 599, 300), reused.bottom);
+    assert.strictEqual(rescale(region.right, 495, 248), reused.right);
+    attention(flopFile).reuse(8).region(function(err, flop) {
+      if (err) throw err;
+      assert.strictEqual(false, flop.reused);
+    });
+  });
+});
+
+attention(fixtureFile).reuse(8).point(function(err, point) {
+  if (err) throw err;
+  assert.strictEqual(false, point.reused);
+  attention(smallFile).reuse(8).point(function(err, reused) {
+    if (err) throw err;
+    assert.strictEqual(true, reused.reused);
+    assert.strictEqual(rescale(point.x, 495, 248), reused.x);
+    assert.strictEqual(rescale(point.y, 599, 300), reused.y);
+    attention(flopFile).reuse(8).point(function(err, flop) {
+      if (err) throw err;
+      assert.strictEqual(false, flop.reused);
+    });
+  });
+});
+
+attention(fixtureFile).reuse(8).swatches(2).palette(function(err, palette) {
+  if (err) throw err;
+  assert.strictEqual(false, palette.reused);
+  attention(smallFile).reuse(8).swatches(2).palette(function(err, reused) {
+    if (err) throw err;
+    assert.strictEqual(true, reused.reused);
+    assert.deepEqual(palette.swatches, reused.swatches);
+    attention(flopFile).reuse(8).swatches(2).palette(function(err, flop) {
+      if (err) throw err;
+      assert.strictEqual(false, flop.reused);
+    });
+  });
+});
+
+// A stored region must not hide the palette of the same near-duplicate
+attention(fixtureFile).reuse(8).region(function(err) {
+  if (err) throw err;
+  attention(fixtureFile).reuse(8).swatches(5).palette(function(err, palette) {
+    if (err) throw err;
+    attention(smallFile).reuse(8).swatches(5).palette(function(err, reused) {
+      if (err) throw err;
+      assert.strictEqual(true, reused.reused);
+      assert.deepEqual(palette.swatches, reused.swatches);
+    });
+  });
+});
+
+assert.throws(function() {
+  attention(fixtureFile).reuse(65);
+});
+
+// Embedded sRGB profile takes the fast path, leaving pixel values unchanged
+var srgbFile = path.join(__dirname, 'divided-attention-srgb.jpg');
+var untaggedFile = path.join(__dirname, 'divided-attention-untagged.jpg');
+attention(srgbFile).swatches(3).palette(function(err, tagged) {
+  if (err) throw err;
+  attention(untaggedFile).swatches(3).palette(function(err, untagged) {
+    if (err) throw err;
+    assert.deepEqual(untagged.swatches, tagged.swatches);
+  });
+});
+
+// 16-bit input with embedded Adobe RGB profile falls back to icc_import
+attention(path.join(__dirname, 'divided-attention-16bit.png')).swatches(1).palette(function(err, palette) {
+  if (err) throw err;
+  assert.strictEqual(1, palette.swatches.length);
+  assertSwatch(palette.swatches[0]);
+  assert.strictEqual(true, Math.abs(palette.swatches[0].r - 96) <= 4, palette.swatches[0].r);
+  assert.strictEqual(true, Math.abs(palette.swatches[0].g - 73) <= 4, palette.swatches[0].g);
+  assert.strictEqual(true, Math.abs(palette.swatches[0].b - 58) <= 4, palette.swatches[0].b);
 });
@@ -0,0 +1,70 @@
+'use strict';
+
+// Measure throughput of region() as the number of worker_threads increases
+// Requires Node.js with worker_threads support
+
+var os = require('os');
+var path = require('path');
+
+// Share one native thread pool sized to the machine, set before first use
+if (!process.env.UV_THREADPOOL_SIZE) {
+  process.env.UV_THREADPOOL_SIZE = os.cpus().length;
+}
+
+var threads = require('worker_threads');
+var attention = require('../');
+
+var fixtureFile = path.join(__dirname, 'divided-attention.jpg');
+var imagesPerWorker = 50;
+
+if (!threads.isMainThread) {
+  // Worker: analyse the fixture sequentially, reporting when done
+  var remaining = threads.workerData.images;
+  var next = function() {
+    attention(fixtureFile).region(function(err) {
+      if (err) throw err;
+      remaining--;
+      if (remaining > 0) {
+        next();
+      } else {
+        threads.parentPort.postMessage('done');
+      }
+    });
+  };
+  next();
+} else {
+  var workerCounts = [];
+  for (var count = 1; count <= os.cpus().length; count = count * 2) {
+    workerCounts.push(count);
+  }
+
+  var run = function(index) {
+    if (index === workerCounts.length) {
+      return;
+    }
+    var workers = workerCounts[index];
+    var finished = 0;
+    var start = process.hrtime();
+    for (var i = 0; i < workers; i++) {
+      var worker = new threads.Worker(__filename, { workerData: { images: imagesPerWorker } });
+      worker.on('error', function(err) {
+        throw err;
+      });
+      worker.on('message', function() {
+        finished++;
+        if (finished === workers) {
+          var elapsed = process.hrtime(start);
+          var seconds = elapsed[0] + elapsed[1] / 1e9;
+          console.log(workers + ' worker(s): ' + (workers * imagesPerWorker / seconds).toFixed(1) + ' images/sec');
+          run(index + 1);
+        }
+      });
+    }
+  };
+
+  // Verify the addon also loads in the main thread alongside the workers
+  attention(fixtureFile).region(function(err) {
+    if (err) throw err;
+    run(0);
+  });
+}